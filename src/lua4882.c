@@ -44,13 +44,37 @@ https://www.ni.com/en/about-ni/legal/software-license-agreement.html
 
 #include <ni4882.h>
 
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
 #define TRUE 1
 #define FALSE 0
 #define ASCIISTRING 0
 #define CHARTABLE   1
 #define BINTABLE    2
+#define MSGSTRING   0
+#define MSGTABLE    1
 #define NUM_OPTIONS_IBCONFIG	26
 #define LUA4882_VERSION "lua4882 1.2.1"
+#define FRAME_REGISTRY  "lua4882.frames"
+#define FRAME_METATABLE "lua4882.frame"
+
+// Per-handle carry-over buffer of ibrdmsg(). Bytes in [head,tail) have been
+// read from the device but not yet handed out to Lua. Bytes in [head,scanned)
+// are already known to contain no EOS character and are not scanned again.
+typedef struct {
+  char *buf;		// carry-over buffer
+  size_t cap;		// allocated size of buf
+  size_t head;		// first byte not yet returned to Lua
+  size_t tail;		// end of valid data
+  size_t scanned;	// end of EOS-free region starting at head
+  int eos;		// EOS character, -1 if not yet queried via ibask()
+  int end;		// END received with last read, remainder is complete
+  unsigned int status;	// IBSTA of last read delivering data, ERR masked off
+  unsigned int errStatus;	// IBSTA of deferred read error, 0 if none
+  int err;		// IBERR of deferred read error
+} lua4882_frame;
 
 // Ibconfig() Ibask() options, taken from ni4882.h
 const char optMnemonic[NUM_OPTIONS_IBCONFIG][18] = {
@@ -67,6 +91,12 @@ const unsigned int optCode[NUM_OPTIONS_IBCONFIG] = {
   IbcEndBitIsNormal, IbcUnAddr, IbcHSCableLength, IbcIst, IbcRsv,
   IbcLON, IbcEOS};
 
+// Ibsta() bits, also used as ibwait() mask bits
+const char staMnemonic[16][5] = {"DCAS","DTAS","LACS","TACS",
+				 "ATN", "CIC", "REM", "LOK",
+				 "CMPL","",    "",    "RQS",
+				 "SRQI","END", "TIMO","ERR"};
+
 #ifdef _WINDLL
 
 //------------------------------------------------------------------------------
@@ -153,11 +183,7 @@ static const char* errorMnemonic(int err) {
 //------------------------------------------------------------------------------
 static void pushIbsta(lua_State *L, unsigned int status){
   // Pushes content of Ibsta on stack (as table) as return value
-  
-  const char bitMnemonic[16][5] = {"DCAS","DTAS","LACS","TACS",
-				   "ATN", "CIC", "REM", "LOK",
-				   "CMPL","",    "",    "RQS",
-				   "SRQI","END", "TIMO","ERR"};
+
   // build table
   lua_newtable(L);
   int top = lua_gettop(L);
@@ -165,9 +191,9 @@ static void pushIbsta(lua_State *L, unsigned int status){
   // push index/value-pairs on stack
   for (int i=0; i<16; i++) {
     // skip unused bits
-    if (strcmp(bitMnemonic[i],"") == 0) continue;
+    if (strcmp(staMnemonic[i],"") == 0) continue;
     // push index
-    lua_pushstring(L,bitMnemonic[i]);
+    lua_pushstring(L,staMnemonic[i]);
     // push value
     lua_pushboolean(L,(status & (1 << i)) >> i);
     // assign table[index] = value
@@ -187,6 +213,92 @@ static int luaL_checkboolean(lua_State *L, int idx){
   }
 }
 
+//------------------------------------------------------------------------------
+static int frameGc(lua_State *L){
+  // Release carry-over buffer of a frame userdata when collected
+  lua4882_frame *frame = (lua4882_frame*)luaL_checkudata(L,1,FRAME_METATABLE);
+  free(frame->buf);
+  frame->buf = NULL;
+  frame->cap = 0;
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+static lua4882_frame* getFrame(lua_State *L, int descr, int create){
+  // Returns the frame of device descriptor descr. Frames are kept in a registry
+  // table indexed by descriptor. Returns NULL if there is no frame and create
+  // is FALSE. Leaves the Lua stack unchanged.
+  lua4882_frame *frame = NULL;
+  luaL_getsubtable(L,LUA_REGISTRYINDEX,FRAME_REGISTRY);
+  if (lua_rawgeti(L,-1,descr) == LUA_TUSERDATA) {
+    frame = (lua4882_frame*)lua_touserdata(L,-1);
+  }
+  else if (create) {
+    frame = (lua4882_frame*)lua_newuserdatauv(L,sizeof(lua4882_frame),0);
+    memset(frame,0,sizeof(lua4882_frame));
+    frame->eos = -1;
+    luaL_setmetatable(L,FRAME_METATABLE);
+    lua_rawseti(L,-3,descr);	// anchors frame, also pops it from stack
+  }
+  lua_pop(L,2);			// frame (or nil) and registry table
+  return frame;
+}
+
+//------------------------------------------------------------------------------
+static void resetFrame(lua4882_frame *frame){
+  // Discard all buffered data, but keep the allocated buffer for reuse
+  frame->head = 0;
+  frame->tail = 0;
+  frame->scanned = 0;
+  frame->end = FALSE;
+}
+
+//------------------------------------------------------------------------------
+static void frameOptionChanged(lua_State *L, int descr, int option){
+  // Called after successful ibconfig(). If the EOS character changed,
+  // ibrdmsg() re-queries it on next call and rescans all buffered data.
+  if (option == IbcEOSchar || option == IbcEOS) {
+    lua4882_frame *frame = getFrame(L,descr,FALSE);
+    if (frame != NULL) {
+      frame->eos = -1;
+      frame->scanned = frame->head;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+static char* frameFindEos(lua4882_frame *frame){
+  // Returns pointer to next EOS character in [head,tail) or NULL. memchr() is
+  // vectorized by the C runtime, and already scanned bytes are skipped.
+  if (frame->scanned == frame->tail) {
+    return NULL;
+  }
+  char *pos = memchr(frame->buf + frame->scanned,frame->eos,
+		     frame->tail - frame->scanned);
+  frame->scanned = (pos != NULL) ? (size_t)(pos - frame->buf) : frame->tail;
+  return pos;
+}
+
+//------------------------------------------------------------------------------
+static void pushFrameMessage(lua_State *L, lua4882_frame *frame, char *eosPos){
+  // Pushes next message (EOS character stripped) as string and consumes it.
+  // With eosPos == NULL the whole remainder is pushed.
+  char *start = frame->buf + frame->head;
+  if (eosPos != NULL) {
+    lua_pushlstring(L,start,eosPos - start);
+    frame->head = (size_t)(eosPos - frame->buf) + 1;
+    frame->scanned = frame->head;
+  }
+  else {
+    lua_pushlstring(L,start,frame->tail - frame->head);
+    frame->head = frame->tail;
+  }
+  if (frame->head == frame->tail) {
+    // Buffer drained, start over at the beginning of the buffer
+    resetFrame(frame);
+  }
+}
+
 //------------------------------------------------------------------------------
 static int lua4882_ibask(lua_State *L) {
   // Return information about software configuration parameters.
@@ -253,6 +365,12 @@ static int lua4882_ibclr(lua_State *L){
   }
   else {
     // OK
+    lua4882_frame *frame = getFrame(L,descr,FALSE);
+    if (frame != NULL) {
+      // Device was cleared, stale ibrdmsg() data is meaningless now
+      resetFrame(frame);
+      frame->errStatus = 0;
+    }
     pushIbsta(L,status);			// IBSTA table
     lua_pushnil(L);				// no errmsg
   }
@@ -295,6 +413,7 @@ static int lua4882_ibconfig(lua_State *L) {
   }
   else {
     // OK
+    frameOptionChanged(L,descr,optCode[givenOptIdx]);
     pushIbsta(L,status);			// IBSTA table
     lua_pushnil(L);				// no errmsg
   }
@@ -385,6 +504,13 @@ static int lua4882_ibonl(lua_State *L) {
   }
   else {
     // OK
+    if (!state) {
+      // Descriptor is invalid now, drop its ibrdmsg() frame
+      luaL_getsubtable(L,LUA_REGISTRYINDEX,FRAME_REGISTRY);
+      lua_pushnil(L);
+      lua_rawseti(L,-2,descr);
+      lua_pop(L,1);
+    }
     pushIbsta(L,status);			// IBSTA table
     lua_pushnil(L);				// no errmsg
   }
@@ -481,6 +607,145 @@ static int lua4882_ibrd(lua_State *L) {
   return 3;
 }
 
+//------------------------------------------------------------------------------
+static int lua4882_ibrdmsg(lua_State *L) {
+  // Read EOS-terminated messages from a device. Data following the last
+  // complete message is kept in a per-handle carry-over buffer and returned by
+  // subsequent calls. The device is only read if the buffer holds no complete
+  // message. count is the chunk size of each underlying ibrd() call. A
+  // remainder without EOS character counts as complete message when END was
+  // received. The EOS character itself is stripped.
+  //
+  // Additional option for configuring read data to Lua:
+  // No option   : Return next message as string
+  // "msgTable"  : Return all complete messages in table with 1-based indexing
+
+  // Check arguments
+  int descr, output;
+  lua_Integer chunk;
+  if (lua_gettop(L) == 2) {
+    // Two arguments, return one message.
+    descr = (int)luaL_checkinteger(L,1);
+    chunk = luaL_checkinteger(L,2);
+    output = MSGSTRING;
+  }
+  else if (lua_gettop(L) == 3) {
+    // Three arguments, return all messages.
+    descr = (int)luaL_checkinteger(L,1);
+    chunk = luaL_checkinteger(L,2);
+    if (strcmp(luaL_checkstring(L,3),"msgTable") == 0) {
+      output = MSGTABLE;
+    }
+    else {
+      return luaL_error(L,"Optional 3rd argument must be \"msgTable\".");
+    }
+  } else {
+    // bailing out
+    return luaL_error(L,"Wrong number of arguments.");
+  }
+  luaL_argcheck(L,chunk > 0,2,"Chunk size must be greater than 0.");
+  size_t count = (size_t)chunk;
+  // Preparations
+  lua4882_frame *frame = getFrame(L,descr,TRUE);
+  if (frame->eos < 0) {
+    // Query EOS character once, ibconfig() invalidates it when changed
+    int eosChar;
+    unsigned int status = ibask(descr,IbcEOSchar,&eosChar);
+    if (Ibsta() & ERR) {
+      // failed
+      lua_pushnil(L);				// no received data
+      pushIbsta(L,status);			// IBSTA table
+      lua_pushstring(L,errorMnemonic(Iberr()));	// errmsg
+      return 3;
+    }
+    frame->eos = eosChar & 0xff;
+  }
+  // Read from device until at least one complete message is buffered
+  char *eosPos;
+  while ((eosPos = frameFindEos(frame)) == NULL && !frame->end) {
+    if (frame->errStatus != 0) {
+      // Report read error deferred by previous call
+      unsigned int status = frame->errStatus;
+      frame->errStatus = 0;
+      lua_pushnil(L);				// no received data
+      pushIbsta(L,status);			// IBSTA table
+      lua_pushstring(L,errorMnemonic(frame->err));	// errmsg
+      return 3;
+    }
+    if (frame->head > 0) {
+      // Move incomplete remainder to start of buffer
+      memmove(frame->buf,frame->buf + frame->head,frame->tail - frame->head);
+      frame->tail -= frame->head;
+      frame->scanned -= frame->head;
+      frame->head = 0;
+    }
+    if (frame->cap - frame->tail < count) {
+      if (count > SIZE_MAX - frame->tail) {
+	return luaL_error(L,"Unable to allocate read buffer.");
+      }
+      // Grow geometrically, long messages must not realloc on every chunk
+      size_t newCap = frame->tail + count;
+      if (frame->cap <= SIZE_MAX / 2 && 2 * frame->cap > newCap) {
+	newCap = 2 * frame->cap;
+      }
+      char *newBuf = realloc(frame->buf,newCap);
+      if (newBuf == NULL) {
+	return luaL_error(L,"Unable to allocate read buffer.");
+      }
+      frame->buf = newBuf;
+      frame->cap = newCap;
+    }
+    // Call C-function
+    unsigned int status = ibrd(descr,frame->buf + frame->tail,count);
+    // Keep partially transferred data even on error, nothing gets lost
+    frame->tail += min(Ibcnt(),count);
+    if (Ibsta() & ERR) {
+      if (frameFindEos(frame) != NULL) {
+	// Complete messages received before the error are handed out first,
+	// the error is reported once they are consumed. They come with the
+	// status of this read, ERR masked off.
+	frame->errStatus = status;
+	frame->err = Iberr();
+	frame->status = status & ~ERR;
+	continue;
+      }
+      // failed
+      lua_pushnil(L);				// no received data
+      pushIbsta(L,status);			// IBSTA table
+      lua_pushstring(L,errorMnemonic(Iberr()));	// errmsg
+      return 3;
+    }
+    frame->status = status;
+    frame->end = (status & END) ? TRUE : FALSE;
+  }
+  // Hand out buffered messages
+  unsigned int status = frame->status;
+  if (output == MSGTABLE) {
+    lua_newtable(L);
+    lua_Integer idx = 0;
+    while (eosPos != NULL) {
+      pushFrameMessage(L,frame,eosPos);
+      lua_rawseti(L,-2,++idx);		// Lua 1-based indexing
+      eosPos = frameFindEos(frame);
+    }
+    if (frame->end && frame->tail > frame->head) {
+      // END-terminated remainder
+      pushFrameMessage(L,frame,NULL);
+      lua_rawseti(L,-2,++idx);
+    }
+    if (frame->head == frame->tail) {
+      // Also covers END without data, next call reads from device again
+      resetFrame(frame);
+    }
+  }
+  else {
+    pushFrameMessage(L,frame,eosPos);
+  }
+  pushIbsta(L,status);			// IBSTA table
+  lua_pushnil(L);				// no errmsg
+  return 3;
+}
+
 //------------------------------------------------------------------------------
 static int lua4882_ibrsp(lua_State *L){
   // Conduct a serial poll.
@@ -682,6 +947,120 @@ static int lua4882_ibwrt(lua_State *L) {
   return 3;
 }
 
+//------------------------------------------------------------------------------
+static int lua4882_errstr(lua_State *L) {
+  // Return error message of an iberr code, e.g. as returned by gpib.fast
+  // functions.
+  lua_pushstring(L,errorMnemonic((int)luaL_checkinteger(L,1)));
+  return 1;
+}
+
+//------------------------------------------------------------------------------
+// gpib.fast - Fast path functions for hot loops
+//
+// Same operations as their ib* counterparts, but no tables and no error
+// strings are created. Options and masks are given as integer codes, see
+// gpib.fast.opt and gpib.fast.mask. Argument counts are not checked. All
+// functions return ibsta, iberr and ibcnt as integers, preceded by the data
+// for functions returning data. Like with the driver itself, iberr is only
+// meaningful if ERR is set in ibsta (note that 0 is EDVR).
+//------------------------------------------------------------------------------
+static int pushFastStatus(lua_State *L, unsigned int status){
+  // Pushes ibsta, iberr, ibcnt as integers, returns number of values
+  lua_pushinteger(L,(lua_Integer)status);
+  lua_pushinteger(L,(lua_Integer)Iberr());
+  lua_pushinteger(L,(lua_Integer)Ibcnt());
+  return 3;
+}
+
+//------------------------------------------------------------------------------
+static int lua4882_fast_ask(lua_State *L) {
+  // value, ibsta, iberr, ibcnt = gpib.fast.ask(ud, option)
+  int optVal = 0;
+  unsigned int status = ibask((int)luaL_checkinteger(L,1),
+			      (int)luaL_checkinteger(L,2),&optVal);
+  if (status & ERR) {
+    lua_pushnil(L);				// no option value
+  }
+  else {
+    lua_pushinteger(L,optVal);			// Current option content
+  }
+  return 1 + pushFastStatus(L,status);
+}
+
+//------------------------------------------------------------------------------
+static int lua4882_fast_config(lua_State *L) {
+  // ibsta, iberr, ibcnt = gpib.fast.config(ud, option, value)
+  int descr = (int)luaL_checkinteger(L,1);
+  int option = (int)luaL_checkinteger(L,2);
+  unsigned int status = ibconfig(descr,option,(int)luaL_checkinteger(L,3));
+  if (!(status & ERR)) {
+    frameOptionChanged(L,descr,option);
+  }
+  return pushFastStatus(L,status);
+}
+
+//------------------------------------------------------------------------------
+static int lua4882_fast_rd(lua_State *L) {
+  // data, ibsta, iberr, ibcnt = gpib.fast.rd(ud, count)
+  // Reads directly into a Lua buffer, no intermediate malloc()/free().
+  int descr = (int)luaL_checkinteger(L,1);
+  size_t count = (size_t)luaL_checkinteger(L,2);
+  luaL_Buffer b;
+  char *rdBuf = luaL_buffinitsize(L,&b,count);
+  unsigned int status = ibrd(descr,rdBuf,count);
+  if (status & ERR) {
+    lua_pushnil(L);				// no received data
+  }
+  else {
+    luaL_pushresultsize(&b,min(Ibcnt(),count));	// data as string
+  }
+  return 1 + pushFastStatus(L,status);
+}
+
+//------------------------------------------------------------------------------
+static int lua4882_fast_rsp(lua_State *L) {
+  // spr, ibsta, iberr, ibcnt = gpib.fast.rsp(ud)
+  char response = 0x0;
+  unsigned int status = ibrsp((int)luaL_checkinteger(L,1),&response);
+  if (status & ERR) {
+    lua_pushnil(L);				// no response byte
+  }
+  else {
+    lua_pushinteger(L,((lua_Integer)response) & 0xff);	// response byte
+  }
+  return 1 + pushFastStatus(L,status);
+}
+
+//------------------------------------------------------------------------------
+static int lua4882_fast_trg(lua_State *L) {
+  // ibsta, iberr, ibcnt = gpib.fast.trg(ud)
+  return pushFastStatus(L,ibtrg((int)luaL_checkinteger(L,1)));
+}
+
+//------------------------------------------------------------------------------
+static int lua4882_fast_wait(lua_State *L) {
+  // ibsta, iberr, ibcnt = gpib.fast.wait(ud, mask)
+  return pushFastStatus(L,ibwait((int)luaL_checkinteger(L,1),
+				 (int)luaL_checkinteger(L,2)));
+}
+
+//------------------------------------------------------------------------------
+static int lua4882_fast_wrt(lua_State *L) {
+  // count, ibsta, iberr, ibcnt = gpib.fast.wrt(ud, data)
+  size_t len;
+  int descr = (int)luaL_checkinteger(L,1);
+  const char *txData = luaL_checklstring(L,2,&len);
+  unsigned int status = ibwrt(descr,txData,len);
+  if (status & ERR) {
+    lua_pushnil(L);				// no number of bytes sent
+  }
+  else {
+    lua_pushinteger(L,(lua_Integer)Ibcnt());	// Number of bytes sent
+  }
+  return 1 + pushFastStatus(L,status);
+}
+
 #else
 // FIXME - non-_WINDLL not yet implemented
 #endif
@@ -695,6 +1074,7 @@ static const struct luaL_Reg lua4882_metamethods [] = {
   {"__call", lua4882_ibfind},
   {"__call", lua4882_ibonl},
   {"__call", lua4882_ibrd},
+  {"__call", lua4882_ibrdmsg},
   {"__call", lua4882_ibrsp},
   {"__call", lua4882_ibtrg},
   {"__call", lua4882_ibwait},
@@ -703,6 +1083,7 @@ static const struct luaL_Reg lua4882_metamethods [] = {
 };
 
 static const struct luaL_Reg lua4882_funcs [] = {
+  {"errstr",   lua4882_errstr},
   {"ibask",    lua4882_ibask},
   {"ibclr",    lua4882_ibclr},
   {"ibconfig", lua4882_ibconfig},
@@ -710,6 +1091,7 @@ static const struct luaL_Reg lua4882_funcs [] = {
   {"ibfind",   lua4882_ibfind},
   {"ibonl",    lua4882_ibonl},
   {"ibrd",     lua4882_ibrd},
+  {"ibrdmsg",  lua4882_ibrdmsg},
   {"ibrsp",    lua4882_ibrsp},
   {"ibtrg",    lua4882_ibtrg},
   {"ibwait",   lua4882_ibwait},
@@ -717,12 +1099,45 @@ static const struct luaL_Reg lua4882_funcs [] = {
   {NULL, NULL}
 };
 
+static const struct luaL_Reg lua4882_fast_funcs [] = {
+  {"ask",      lua4882_fast_ask},
+  {"config",   lua4882_fast_config},
+  {"rd",       lua4882_fast_rd},
+  {"rsp",      lua4882_fast_rsp},
+  {"trg",      lua4882_fast_trg},
+  {"wait",     lua4882_fast_wait},
+  {"wrt",      lua4882_fast_wrt},
+  {NULL, NULL}
+};
+
 DLL int luaopen_lua4882(lua_State *L){
+  // Metatable of ibrdmsg() frames
+  luaL_newmetatable(L, FRAME_METATABLE);
+  lua_pushcfunction(L, frameGc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
   luaL_newlib(L, lua4882_funcs);
   luaL_newlib(L, lua4882_metamethods);
   lua_setmetatable(L, -2);
   lua_pushliteral(L,LUA4882_VERSION);
   lua_setfield(L,-2,"_VERSION");
+  // gpib.fast namespace with integer codes for options and masks
+  luaL_newlib(L, lua4882_fast_funcs);
+  lua_createtable(L, 0, NUM_OPTIONS_IBCONFIG);
+  for (int i=0; i<NUM_OPTIONS_IBCONFIG; i++) {
+    lua_pushinteger(L, optCode[i]);
+    lua_setfield(L, -2, optMnemonic[i]);
+  }
+  lua_setfield(L, -2, "opt");
+  lua_newtable(L);
+  for (int i=0; i<16; i++) {
+    // skip unused bits
+    if (strcmp(staMnemonic[i],"") == 0) continue;
+    lua_pushinteger(L, 1 << i);
+    lua_setfield(L, -2, staMnemonic[i]);
+  }
+  lua_setfield(L, -2, "mask");
+  lua_setfield(L, -2, "fast");
   return 1;
 }
 //------------------------------------------------------------------------------
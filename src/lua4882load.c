@@ -0,0 +1,428 @@
+/*
+--------------------------------------------------------------------------------
+MIT License
+
+lua4882 - Copyright (c) 2024-2025 Kritzel Kratzel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+--------------------------------------------------------------------------------
+*/
+
+// lua4882load - soak/load test driver for lua4882
+//
+// Starts N Lua states on M threads. Every state requires lua4882, linked
+// against the simulated bus in sim4882.c, opens one device and cycles through
+// ibwrt/ibrsp/ibwait/ibrd for a fixed duration. Each call is timed from C
+// around lua_pcall(), so the figures include the Lua/C transition and the
+// construction of the returned tables. The Lua collector runs in its normal
+// mode, so its pauses fall inside the timed calls. In addition one basic
+// LUA_GCSTEP slice per state is timed every GC_INTERVAL cycles.
+//
+// Usage: lua4882load [-n states] [-m threads] [-d seconds] [-l latency_us]
+//                    [-i report_interval_s]
+
+#include <windows.h>
+#include <psapi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include "sim4882.h"
+
+#define TRUE 1
+#define FALSE 0
+#define NUM_OPS		4
+#define HIST_SUB_BITS	5
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	(64 * HIST_SUB)
+#define GC_INTERVAL	1000
+
+int luaopen_lua4882(lua_State *L);	// lua4882.c
+
+// Call sequence of one cycle: SRQ-driven query
+const char opMnemonic[NUM_OPS][7] = {"ibwrt", "ibrsp", "ibwait", "ibrd"};
+
+// Log-linear latency histogram in nanoseconds, relative error below 1/32
+typedef struct {
+  unsigned long long count[HIST_BUCKETS];
+  unsigned long long total;
+} load_hist;
+
+typedef struct {
+  lua_State *L;
+  int ud;			// simulated device descriptor
+} load_state;
+
+typedef struct {
+  HANDLE thread;
+  int numStates;
+  load_state *states;
+  load_hist hist[NUM_OPS];
+  unsigned long long errors;	// calls returning an errmsg or raising
+  char firstError[128];
+  LONGLONG gcTicks;		// time spent in sampled LUA_GCSTEP slices
+  LONGLONG gcMaxTicks;		// longest sampled slice
+  unsigned long long gcSteps;	// number of sampled slices
+  size_t luaMemStart;		// Lua memory of all states in bytes
+  size_t luaMemEnd;
+  int setupFailed;
+} load_worker;
+
+static HANDLE loadReady;		// all workers set up
+static HANDLE loadGo;			// start measurement
+static volatile LONG loadPending;	// workers still in setup
+static LONGLONG loadDeadline;		// QPC ticks, valid once loadGo is set
+static LARGE_INTEGER loadFreq;
+
+//------------------------------------------------------------------------------
+static int histIndex(unsigned long long v){
+  // Values below HIST_SUB are exact, above HIST_SUB sub-buckets per power of 2
+  if (v < HIST_SUB) return (int)v;
+  int e = 63;
+  while ((v >> e) == 0) e--;
+  return (int)((e - HIST_SUB_BITS + 1) * HIST_SUB
+	       + ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1)));
+}
+
+//------------------------------------------------------------------------------
+static unsigned long long histValue(int idx){
+  // Lower bound of bucket idx, inverse of histIndex()
+  if (idx < HIST_SUB) return (unsigned long long)idx;
+  int group = idx / HIST_SUB;
+  int sub = idx % HIST_SUB;
+  return ((unsigned long long)(HIST_SUB + sub)) << (group - 1);
+}
+
+//------------------------------------------------------------------------------
+static void histMerge(load_hist *dst, const load_hist *src){
+  for (int i=0; i<HIST_BUCKETS; i++) {
+    dst->count[i] += src->count[i];
+  }
+  dst->total += src->total;
+}
+
+//------------------------------------------------------------------------------
+static double histPercentile(const load_hist *hist, double p){
+  // Returns percentile p (0..1) in microseconds
+  if (hist->total == 0) return 0.0;
+  unsigned long long target = (unsigned long long)(p * (double)hist->total);
+  if (target == 0) target = 1;
+  unsigned long long sum = 0;
+  for (int i=0; i<HIST_BUCKETS; i++) {
+    sum += hist->count[i];
+    if (sum >= target) return (double)histValue(i) / 1000.0;
+  }
+  return (double)histValue(HIST_BUCKETS - 1) / 1000.0;
+}
+
+//------------------------------------------------------------------------------
+static size_t luaMemory(lua_State *L){
+  // Memory in use by Lua state in bytes
+  return (size_t)lua_gc(L,LUA_GCCOUNT,0) * 1024 + (size_t)lua_gc(L,LUA_GCCOUNTB,0);
+}
+
+//------------------------------------------------------------------------------
+static size_t processRss(size_t *peak){
+  // Current working set in bytes, peak working set optionally
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(),&pmc,sizeof(pmc))) {
+    if (peak != NULL) *peak = 0;
+    return 0;
+  }
+  if (peak != NULL) *peak = pmc.PeakWorkingSetSize;
+  return pmc.WorkingSetSize;
+}
+
+//------------------------------------------------------------------------------
+static void workerError(load_worker *w, const char *msg){
+  // Counts failed call, keeps first message for the report
+  if (w->errors++ == 0) {
+    strncpy(w->firstError,(msg != NULL) ? msg : "(no message)",
+	    sizeof(w->firstError) - 1);
+  }
+}
+
+//------------------------------------------------------------------------------
+static int setupState(load_worker *w, load_state *s, int pad){
+  // Creates Lua state with lua4882 loaded and one device opened. The module
+  // table stays at stack index 1, the timed functions at 2..NUM_OPS+1.
+  lua_State *L = luaL_newstate();
+  if (L == NULL) return FALSE;
+  s->L = L;
+  luaL_openlibs(L);
+  luaL_requiref(L,"lua4882",luaopen_lua4882,0);
+  for (int op=0; op<NUM_OPS; op++) {
+    lua_getfield(L,1,opMnemonic[op]);
+  }
+  // gpib.ibdev(0,pad,0,T10s,1,0x0a)
+  lua_getfield(L,1,"ibdev");
+  lua_pushinteger(L,0);
+  lua_pushinteger(L,pad);
+  lua_pushinteger(L,0);
+  lua_pushinteger(L,13);
+  lua_pushinteger(L,1);
+  lua_pushinteger(L,0x0a);
+  if (lua_pcall(L,6,2,0) != LUA_OK || !lua_isinteger(L,-2)) {
+    workerError(w,lua_tostring(L,-1));
+    return FALSE;
+  }
+  s->ud = (int)lua_tointeger(L,-2);
+  lua_pop(L,2);
+  return TRUE;
+}
+
+//------------------------------------------------------------------------------
+static void runOp(load_worker *w, load_state *s, int op){
+  // Calls one lua4882 function and records its latency
+  lua_State *L = s->L;
+  int base = lua_gettop(L);
+  LARGE_INTEGER t0, t1;
+  QueryPerformanceCounter(&t0);
+  lua_pushvalue(L,op + 2);
+  lua_pushinteger(L,s->ud);
+  switch (op) {
+  case 0:
+    lua_pushliteral(L,"MEAS?\n");
+    break;
+  case 1:
+    break;
+  case 2:
+    lua_pushliteral(L,"RQS");
+    break;
+  case 3:
+    lua_pushinteger(L,64);
+    break;
+  }
+  int rc = lua_pcall(L,lua_gettop(L) - base - 1,LUA_MULTRET,0);
+  QueryPerformanceCounter(&t1);
+  unsigned long long ns = (unsigned long long)(t1.QuadPart - t0.QuadPart)
+    * 1000000000ULL / (unsigned long long)loadFreq.QuadPart;
+  w->hist[op].count[histIndex(ns)]++;
+  w->hist[op].total++;
+  // Last return value is errmsg, nil on success
+  if (rc != LUA_OK || !lua_isnil(L,-1)) {
+    workerError(w,lua_tostring(L,-1));
+  }
+  lua_settop(L,base);
+}
+
+//------------------------------------------------------------------------------
+static void sampleGcStep(load_worker *w){
+  // Times one basic incremental GC step per state of worker
+  for (int i=0; i<w->numStates; i++) {
+    LARGE_INTEGER t0, t1;
+    QueryPerformanceCounter(&t0);
+    lua_gc(w->states[i].L,LUA_GCSTEP,0);
+    QueryPerformanceCounter(&t1);
+    LONGLONG ticks = t1.QuadPart - t0.QuadPart;
+    w->gcTicks += ticks;
+    if (ticks > w->gcMaxTicks) w->gcMaxTicks = ticks;
+    w->gcSteps++;
+  }
+}
+
+//------------------------------------------------------------------------------
+static DWORD WINAPI workerMain(LPVOID arg){
+  load_worker *w = (load_worker*)arg;
+  // Setup
+  for (int i=0; i<w->numStates && !w->setupFailed; i++) {
+    if (!setupState(w,&w->states[i],(i % 30) + 1)) {
+      w->setupFailed = TRUE;
+    }
+    else {
+      w->luaMemStart += luaMemory(w->states[i].L);
+    }
+  }
+  if (InterlockedDecrement(&loadPending) == 0) {
+    SetEvent(loadReady);
+  }
+  WaitForSingleObject(loadGo,INFINITE);
+  if (w->setupFailed) return 1;
+  // Load
+  unsigned long long cycle = 0;
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  while (now.QuadPart < loadDeadline) {
+    for (int i=0; i<w->numStates; i++) {
+      for (int op=0; op<NUM_OPS; op++) {
+	runOp(w,&w->states[i],op);
+      }
+    }
+    if (++cycle % GC_INTERVAL == 0) {
+      sampleGcStep(w);
+    }
+    QueryPerformanceCounter(&now);
+  }
+  // Steady state, no final collection
+  for (int i=0; i<w->numStates; i++) {
+    w->luaMemEnd += luaMemory(w->states[i].L);
+  }
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+static void usage(void){
+  fprintf(stderr,
+	  "Usage: lua4882load [-n states] [-m threads] [-d seconds]"
+	  " [-l latency_us] [-i report_interval_s]\n");
+  exit(EXIT_FAILURE);
+}
+
+//------------------------------------------------------------------------------
+static void printRow(const char *name, const load_hist *hist, double seconds){
+  printf("%-8s %12llu %12.0f %10.1f %10.1f %10.1f\n",name,hist->total,
+	 (double)hist->total / seconds,histPercentile(hist,0.50),
+	 histPercentile(hist,0.99),histPercentile(hist,0.999));
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char *argv[]){
+  int numStates = 4, numThreads = 2, duration = 10, interval = 10;
+  int latencyUs = 0;
+  // Check arguments
+  for (int i=1; i<argc; i++) {
+    if (strlen(argv[i]) != 2 || argv[i][0] != '-' || i + 1 >= argc) usage();
+    int value = atoi(argv[++i]);
+    switch (argv[i-1][1]) {
+    case 'n': numStates = value; break;
+    case 'm': numThreads = value; break;
+    case 'd': duration = value; break;
+    case 'l': latencyUs = value; break;
+    case 'i': interval = value; break;
+    default: usage();
+    }
+  }
+  if (numStates < 1 || numThreads < 1 || duration < 1 || latencyUs < 0
+      || interval < 1) {
+    usage();
+  }
+  if (numThreads > numStates) numThreads = numStates;
+  printf("lua4882load: %d states, %d threads, %d s, latency %d us\n",
+	 numStates,numThreads,duration,latencyUs);
+  // Preparations
+  sim4882_setLatency((unsigned int)latencyUs);
+  QueryPerformanceFrequency(&loadFreq);
+  loadReady = CreateEvent(NULL,TRUE,FALSE,NULL);
+  loadGo = CreateEvent(NULL,TRUE,FALSE,NULL);
+  loadPending = numThreads;
+  load_worker *workers = calloc((size_t)numThreads,sizeof(load_worker));
+  load_state *states = calloc((size_t)numStates,sizeof(load_state));
+  if (workers == NULL || states == NULL) {
+    fprintf(stderr,"Unable to allocate workers.\n");
+    return EXIT_FAILURE;
+  }
+  int next = 0;
+  for (int t=0; t<numThreads; t++) {
+    load_worker *w = &workers[t];
+    w->numStates = numStates / numThreads + (t < numStates % numThreads);
+    w->states = &states[next];
+    next += w->numStates;
+    w->thread = CreateThread(NULL,0,workerMain,w,0,NULL);
+    if (w->thread == NULL) {
+      fprintf(stderr,"Unable to create thread %d.\n",t);
+      return EXIT_FAILURE;
+    }
+  }
+  WaitForSingleObject(loadReady,INFINITE);
+  int setupFailed = FALSE;
+  for (int t=0; t<numThreads; t++) {
+    if (workers[t].setupFailed) {
+      fprintf(stderr,"Setup failed: %s\n",workers[t].firstError);
+      setupFailed = TRUE;
+    }
+  }
+  // Run
+  size_t rssStart = processRss(NULL);
+  LARGE_INTEGER start, now;
+  QueryPerformanceCounter(&start);
+  loadDeadline = setupFailed ? 0
+    : start.QuadPart + (LONGLONG)duration * loadFreq.QuadPart;
+  SetEvent(loadGo);
+  if (!setupFailed) {
+    // Periodic RSS samples, steady growth after warm-up indicates a leak
+    for (int elapsed=interval; elapsed<duration; elapsed+=interval) {
+      Sleep((DWORD)interval * 1000);
+      printf("t=%5d s  RSS %10zu KB\n",elapsed,processRss(NULL) / 1024);
+    }
+  }
+  for (int t=0; t<numThreads; t++) {
+    WaitForSingleObject(workers[t].thread,INFINITE);
+    CloseHandle(workers[t].thread);
+  }
+  QueryPerformanceCounter(&now);
+  if (setupFailed) return EXIT_FAILURE;
+  double seconds = (double)(now.QuadPart - start.QuadPart)
+    / (double)loadFreq.QuadPart;
+  size_t rssPeak;
+  size_t rssEnd = processRss(&rssPeak);
+  // Report
+  static load_hist opHist[NUM_OPS], allHist;
+  unsigned long long errors = 0;
+  LONGLONG gcTicks = 0, gcMaxTicks = 0;
+  unsigned long long gcSteps = 0;
+  size_t luaMemStart = 0, luaMemEnd = 0;
+  for (int t=0; t<numThreads; t++) {
+    for (int op=0; op<NUM_OPS; op++) {
+      histMerge(&opHist[op],&workers[t].hist[op]);
+      histMerge(&allHist,&workers[t].hist[op]);
+    }
+    if (workers[t].errors > 0) {
+      printf("Thread %d: %llu errors, first: %s\n",t,workers[t].errors,
+	     workers[t].firstError);
+    }
+    errors += workers[t].errors;
+    gcTicks += workers[t].gcTicks;
+    gcSteps += workers[t].gcSteps;
+    if (workers[t].gcMaxTicks > gcMaxTicks) gcMaxTicks = workers[t].gcMaxTicks;
+    luaMemStart += workers[t].luaMemStart;
+    luaMemEnd += workers[t].luaMemEnd;
+  }
+  printf("\n%-8s %12s %12s %10s %10s %10s\n","op","calls","calls/s",
+	 "p50[us]","p99[us]","p99.9[us]");
+  for (int op=0; op<NUM_OPS; op++) {
+    printRow(opMnemonic[op],&opHist[op],seconds);
+  }
+  printRow("total",&allHist,seconds);
+  double tickUs = 1000000.0 / (double)loadFreq.QuadPart;
+  printf("\nDuration      : %.2f s\n",seconds);
+  printf("Errors        : %llu\n",errors);
+  printf("RSS           : start %zu KB, end %zu KB, peak %zu KB, growth %+lld KB\n",
+	 rssStart / 1024,rssEnd / 1024,rssPeak / 1024,
+	 ((long long)rssEnd - (long long)rssStart) / 1024);
+  printf("Lua memory    : start %zu KB, end %zu KB, growth %+lld KB\n",
+	 luaMemStart / 1024,luaMemEnd / 1024,
+	 ((long long)luaMemEnd - (long long)luaMemStart) / 1024);
+  printf("Lua GC step   : avg %.1f us, max %.1f us (%llu sampled slices)\n",
+	 (gcSteps > 0) ? (double)gcTicks * tickUs / (double)gcSteps : 0.0,
+	 (double)gcMaxTicks * tickUs,gcSteps);
+  // Cleanup
+  for (int i=0; i<numStates; i++) {
+    lua_close(states[i].L);
+  }
+  free(states);
+  free(workers);
+  CloseHandle(loadGo);
+  CloseHandle(loadReady);
+  return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,227 @@
+/*
+--------------------------------------------------------------------------------
+MIT License
+
+lua4882 - Copyright (c) 2024-2025 Kritzel Kratzel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+--------------------------------------------------------------------------------
+*/
+
+// lua4882test - regression tests for lua4882
+//
+// Runs Lua test cases against lua4882 linked with the simulated bus in
+// sim4882.c. Besides the module as global gpib, every case sees a table sim
+// to script the device output: sim.queue(ud,data,end) appends data,
+// sim.fail(ud,err) makes the next read fail with iberr err, and sim.reads()
+// returns the number of ibrd() calls so far. Exits with EXIT_FAILURE if any
+// case fails.
+//
+// Usage: lua4882test
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ni4882.h>
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include "sim4882.h"
+
+#define TRUE 1
+#define FALSE 0
+
+int luaopen_lua4882(lua_State *L);	// lua4882.c
+
+// Shared helpers of all test cases
+static const char testPrelude[] =
+  "function newdev()\n"
+  "  return assert(gpib.ibdev(0,1,0,13,1,0x0a))\n"
+  "end\n"
+  "function eq(got,expected,what)\n"
+  "  if got ~= expected then\n"
+  "    error(what..': expected '..tostring(expected)..', got '..tostring(got),2)\n"
+  "  end\n"
+  "end\n";
+
+typedef struct {
+  const char *name;
+  const char *chunk;
+} test_case;
+
+static const test_case testCases[] = {
+  {"ibrdmsg: several messages in one read",
+   "local ud = newdev()\n"
+   "sim.queue(ud,'a\\nb\\nc\\n',true)\n"
+   "local r = sim.reads()\n"
+   "local t, stat, err = gpib.ibrdmsg(ud,64,'msgTable')\n"
+   "eq(err,nil,'errmsg')\n"
+   "eq(#t,3,'messages')\n"
+   "eq(t[1],'a','t[1]') eq(t[2],'b','t[2]') eq(t[3],'c','t[3]')\n"
+   "eq(stat.END,true,'END')\n"
+   "eq(sim.reads()-r,1,'reads')\n"
+   "sim.queue(ud,'x\\ny\\n',true)\n"
+   "r = sim.reads()\n"
+   "eq(gpib.ibrdmsg(ud,64),'x','1st message')\n"
+   "eq(gpib.ibrdmsg(ud,64),'y','2nd message')\n"
+   "eq(sim.reads()-r,1,'reads')\n"},
+  {"ibrdmsg: remainder carried over between calls",
+   "local ud = newdev()\n"
+   "sim.queue(ud,'1.23\\n4.5',false)\n"
+   "local t = gpib.ibrdmsg(ud,64,'msgTable')\n"
+   "eq(#t,1,'messages')\n"
+   "eq(t[1],'1.23','t[1]')\n"
+   "sim.queue(ud,'6\\n',true)\n"
+   "eq(gpib.ibrdmsg(ud,64),'4.56','carried message')\n"
+   "sim.queue(ud,'abcdefghij\\n',true)\n"
+   "local r = sim.reads()\n"
+   "eq(gpib.ibrdmsg(ud,4),'abcdefghij','message longer than chunk')\n"
+   "eq(sim.reads()-r,3,'reads')\n"},
+  {"ibrdmsg: END without EOS",
+   "local ud = newdev()\n"
+   "sim.queue(ud,'7.8',true)\n"
+   "local m, stat = gpib.ibrdmsg(ud,64)\n"
+   "eq(m,'7.8','message')\n"
+   "eq(stat.END,true,'END')\n"
+   "sim.queue(ud,'a\\n7.9',true)\n"
+   "local t = gpib.ibrdmsg(ud,64,'msgTable')\n"
+   "eq(#t,2,'messages')\n"
+   "eq(t[1],'a','t[1]') eq(t[2],'7.9','t[2]')\n"},
+  {"ibrdmsg: END with no data in msgTable mode",
+   "local ud = newdev()\n"
+   "sim.queue(ud,'',true)\n"
+   "local t, stat, err = gpib.ibrdmsg(ud,64,'msgTable')\n"
+   "eq(err,nil,'errmsg')\n"
+   "eq(#t,0,'messages')\n"
+   "eq(stat.END,true,'END')\n"
+   "sim.queue(ud,'z\\n',true)\n"
+   "local r = sim.reads()\n"
+   "t = gpib.ibrdmsg(ud,64,'msgTable')\n"
+   "eq(#t,1,'messages')\n"
+   "eq(t[1],'z','t[1]')\n"
+   "eq(sim.reads()-r,1,'reads')\n"},
+  {"ibrdmsg: EOS character changed while data is buffered",
+   "local ud = newdev()\n"
+   "sim.queue(ud,'p;q;r',false)\n"
+   "local m, stat, err = gpib.ibrdmsg(ud,64)\n"
+   "eq(m,nil,'message')\n"
+   "eq(stat.TIMO,true,'TIMO')\n"
+   "local cstat, cerr = gpib.ibconfig(ud,'IbcEOSchar',0x3b)\n"
+   "eq(cerr,nil,'ibconfig errmsg')\n"
+   "local r = sim.reads()\n"
+   "eq(gpib.ibrdmsg(ud,64),'p','1st message')\n"
+   "eq(gpib.ibrdmsg(ud,64),'q','2nd message')\n"
+   "eq(sim.reads()-r,0,'reads')\n"},
+  {"ibrdmsg: error after complete messages",
+   "local ud = newdev()\n"
+   "sim.queue(ud,'m1\\nm2\\npart',false)\n"
+   "sim.fail(ud,sim.EABO)\n"
+   "local m, stat, err = gpib.ibrdmsg(ud,64)\n"
+   "eq(m,'m1','1st message')\n"
+   "eq(err,nil,'errmsg')\n"
+   "eq(stat.CMPL,true,'CMPL')\n"
+   "eq(stat.ERR,false,'ERR')\n"
+   "eq(gpib.ibrdmsg(ud,64),'m2','2nd message')\n"
+   "local r = sim.reads()\n"
+   "m, stat, err = gpib.ibrdmsg(ud,64)\n"
+   "eq(m,nil,'message')\n"
+   "eq(stat.ERR,true,'ERR')\n"
+   "eq(string.sub(err,1,4),'EABO','errmsg')\n"
+   "eq(sim.reads()-r,0,'reads')\n"
+   "sim.queue(ud,'ial\\n',true)\n"
+   "eq(gpib.ibrdmsg(ud,64),'partial','carried message')\n"},
+  {"ibrdmsg: chunk size validation",
+   "local ud = newdev()\n"
+   "eq(pcall(gpib.ibrdmsg,ud,0),false,'zero chunk')\n"
+   "eq(pcall(gpib.ibrdmsg,ud,-1),false,'negative chunk')\n"},
+};
+
+//------------------------------------------------------------------------------
+static int simQueue(lua_State *L){
+  // sim.queue(ud,data,end)
+  int ud = (int)luaL_checkinteger(L,1);
+  size_t len;
+  const char *data = luaL_checklstring(L,2,&len);
+  sim4882_queue(ud,data,len,lua_toboolean(L,3));
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+static int simFail(lua_State *L){
+  // sim.fail(ud,err)
+  sim4882_failNextRead((int)luaL_checkinteger(L,1),
+		       (int)luaL_checkinteger(L,2));
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+static int simReads(lua_State *L){
+  // sim.reads()
+  lua_pushinteger(L,(lua_Integer)sim4882_readCount());
+  return 1;
+}
+
+static const struct luaL_Reg simFuncs[] = {
+  {"fail", simFail},
+  {"queue", simQueue},
+  {"reads", simReads},
+  {NULL, NULL}
+};
+
+//------------------------------------------------------------------------------
+static int runCase(const test_case *tc){
+  // Runs one test case in a fresh Lua state
+  lua_State *L = luaL_newstate();
+  if (L == NULL) {
+    printf("FAIL %s: unable to create Lua state\n",tc->name);
+    return FALSE;
+  }
+  luaL_openlibs(L);
+  luaL_requiref(L,"gpib",luaopen_lua4882,1);
+  luaL_newlib(L,simFuncs);
+  lua_pushinteger(L,EABO);
+  lua_setfield(L,-2,"EABO");
+  lua_setglobal(L,"sim");
+  lua_settop(L,0);
+  int ok = (luaL_dostring(L,testPrelude) == LUA_OK
+	    && luaL_loadbuffer(L,tc->chunk,strlen(tc->chunk),tc->name) == LUA_OK
+	    && lua_pcall(L,0,0,0) == LUA_OK);
+  if (ok) {
+    printf("ok   %s\n",tc->name);
+  } else {
+    printf("FAIL %s: %s\n",tc->name,lua_tostring(L,-1));
+  }
+  lua_close(L);
+  return ok;
+}
+
+//------------------------------------------------------------------------------
+int main(void){
+  int numCases = (int)(sizeof(testCases) / sizeof(testCases[0]));
+  int failed = 0;
+  for (int i=0; i<numCases; i++) {
+    if (!runCase(&testCases[i])) failed++;
+  }
+  printf("lua4882test: %d of %d cases passed\n",numCases - failed,numCases);
+  return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
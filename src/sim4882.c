@@ -0,0 +1,308 @@
+/*
+--------------------------------------------------------------------------------
+MIT License
+
+lua4882 - Copyright (c) 2024-2025 Kritzel Kratzel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+--------------------------------------------------------------------------------
+
+National Instruments NI-488.2 API
+Copyright (c) National Instruments 2001-2007. All Rights Reserved.
+https://www.ni.com/en/about-ni/legal/software-license-agreement.html
+
+--------------------------------------------------------------------------------
+*/
+
+// Simulated NI-488.2 bus. Every device behaves like a simple SCPI instrument:
+// writing a query (anything containing '?') queues a fixed EOS-terminated
+// response, which is returned by subsequent reads. Serial polls report RQS
+// while a response is pending. Status variables are kept per thread, like
+// the thread-specific status of the real driver. Tests may queue arbitrary
+// output and make reads fail with sim4882_queue() and sim4882_failNextRead().
+
+#include <windows.h>
+#include <string.h>
+
+#include <ni4882.h>
+
+#include "sim4882.h"
+
+#define TRUE 1
+#define FALSE 0
+#define SIM_MAX_DEVICES	4096
+#define SIM_NUM_OPTIONS	0x40
+#define SIM_OUT_SIZE	1024
+#define SIM_RESPONSE	"+1.23456789E+00\n"
+
+typedef struct {
+  int online;			// descriptor in use
+  int opt[SIM_NUM_OPTIONS];	// ibconfig() option values
+  char out[SIM_OUT_SIZE];	// pending device output
+  size_t outPos;		// read position in pending output
+  size_t outLen;		// length of pending output, 0 if none
+  int outEnd;			// assert END with last byte of pending output
+  int failErr;			// iberr of next failing read, -1 if none
+} sim4882_device;
+
+static sim4882_device simDevice[SIM_MAX_DEVICES];
+static volatile LONG simNextUd = 0;		// ud 0 is board gpib0
+static volatile LONG simLatencyUs = 0;
+static volatile LONG simReads = 0;
+static __declspec(thread) unsigned long simIbsta = 0;
+static __declspec(thread) unsigned long simIberr = 0;
+static __declspec(thread) unsigned long simIbcnt = 0;
+
+//------------------------------------------------------------------------------
+void sim4882_setLatency(unsigned int latencyUs){
+  InterlockedExchange(&simLatencyUs,(LONG)latencyUs);
+}
+
+//------------------------------------------------------------------------------
+static void simQueue(sim4882_device *dev, const char *data, size_t len,
+		     int end){
+  // Appends data to pending output, excess data is dropped
+  if (dev->outPos > 0) {
+    memmove(dev->out,dev->out + dev->outPos,dev->outLen - dev->outPos);
+    dev->outLen -= dev->outPos;
+    dev->outPos = 0;
+  }
+  if (len > SIM_OUT_SIZE - dev->outLen) len = SIM_OUT_SIZE - dev->outLen;
+  memcpy(dev->out + dev->outLen,data,len);
+  dev->outLen += len;
+  dev->outEnd = end;
+}
+
+//------------------------------------------------------------------------------
+static void simDelay(void){
+  // Simulates bus and device latency. Sleep() has millisecond granularity at
+  // best, so only the coarse part is slept and the rest is spent yielding.
+  LONG latencyUs = simLatencyUs;
+  if (latencyUs <= 0) return;
+  LARGE_INTEGER freq, now, until;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  until.QuadPart = now.QuadPart + (freq.QuadPart * latencyUs) / 1000000;
+  if (latencyUs >= 2000) {
+    Sleep((DWORD)(latencyUs / 1000) - 1);
+  }
+  do {
+    SwitchToThread();
+    QueryPerformanceCounter(&now);
+  } while (now.QuadPart < until.QuadPart);
+}
+
+//------------------------------------------------------------------------------
+static unsigned long simStatus(unsigned long status, unsigned long err,
+			       unsigned long cnt){
+  // Updates thread-specific status variables and returns status
+  simIbsta = status;
+  simIberr = err;
+  simIbcnt = cnt;
+  return status;
+}
+
+//------------------------------------------------------------------------------
+static sim4882_device* simLookup(int ud){
+  // Returns device of descriptor ud or NULL if invalid
+  if (ud < 0 || ud >= SIM_MAX_DEVICES || !simDevice[ud].online) {
+    return NULL;
+  }
+  return &simDevice[ud];
+}
+
+//------------------------------------------------------------------------------
+void sim4882_queue(int ud, const char *data, size_t len, int end){
+  sim4882_device *dev = simLookup(ud);
+  if (dev != NULL) simQueue(dev,data,len,end);
+}
+
+//------------------------------------------------------------------------------
+void sim4882_failNextRead(int ud, int err){
+  sim4882_device *dev = simLookup(ud);
+  if (dev != NULL) dev->failErr = err;
+}
+
+//------------------------------------------------------------------------------
+unsigned long sim4882_readCount(void){
+  return (unsigned long)simReads;
+}
+
+//------------------------------------------------------------------------------
+unsigned long NI488CC Ibsta(void){
+  return simIbsta;
+}
+
+unsigned long NI488CC Iberr(void){
+  return simIberr;
+}
+
+unsigned long NI488CC Ibcnt(void){
+  return simIbcnt;
+}
+
+//------------------------------------------------------------------------------
+unsigned long NI488CC ibask(int ud, int option, int *v){
+  sim4882_device *dev = simLookup(ud);
+  if (dev == NULL) return simStatus(ERR,EDVR,0);
+  if (option < 0 || option >= SIM_NUM_OPTIONS) return simStatus(ERR,EARG,0);
+  *v = dev->opt[option];
+  return simStatus(CMPL,0,0);
+}
+
+//------------------------------------------------------------------------------
+unsigned long NI488CC ibclr(int ud){
+  sim4882_device *dev = simLookup(ud);
+  if (dev == NULL) return simStatus(ERR,EDVR,0);
+  simDelay();
+  dev->outPos = 0;
+  dev->outLen = 0;
+  dev->outEnd = FALSE;
+  dev->failErr = -1;
+  return simStatus(CMPL,0,0);
+}
+
+//------------------------------------------------------------------------------
+unsigned long NI488CC ibconfig(int ud, int option, int v){
+  sim4882_device *dev = simLookup(ud);
+  if (dev == NULL) return simStatus(ERR,EDVR,0);
+  if (option < 0 || option >= SIM_NUM_OPTIONS) return simStatus(ERR,EARG,0);
+  dev->opt[option] = v;
+  if (option == IbcEOS) dev->opt[IbcEOSchar] = v & 0xff;
+  return simStatus(CMPL,0,0);
+}
+
+//------------------------------------------------------------------------------
+int NI488CC ibdev(int boardID, int pad, int sad, int tmo, int eot, int eos){
+  (void)boardID;
+  LONG ud = InterlockedIncrement(&simNextUd);
+  if (ud >= SIM_MAX_DEVICES) {
+    simStatus(ERR,EDVR,0);
+    return -1;
+  }
+  sim4882_device *dev = &simDevice[ud];
+  memset(dev,0,sizeof(sim4882_device));
+  dev->opt[IbcPAD] = pad;
+  dev->opt[IbcSAD] = sad;
+  dev->opt[IbcTMO] = tmo;
+  dev->opt[IbcEOT] = eot;
+  dev->opt[IbcEOS] = eos;
+  dev->opt[IbcEOSchar] = eos & 0xff;
+  dev->failErr = -1;
+  dev->online = TRUE;
+  simStatus(CMPL,0,0);
+  return (int)ud;
+}
+
+//------------------------------------------------------------------------------
+int NI488CC ibfind(const char *udname){
+  if (strcmp(udname,"gpib0") != 0) {
+    simStatus(ERR,EDVR,0);
+    return -1;
+  }
+  simDevice[0].online = TRUE;
+  simStatus(CMPL,0,0);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+unsigned long NI488CC ibonl(int ud, int v){
+  sim4882_device *dev = simLookup(ud);
+  if (dev == NULL) return simStatus(ERR,EDVR,0);
+  dev->online = v;
+  return simStatus(CMPL,0,0);
+}
+
+//------------------------------------------------------------------------------
+unsigned long NI488CC ibrd(int ud, void *buf, size_t cnt){
+  sim4882_device *dev = simLookup(ud);
+  if (dev == NULL) return simStatus(ERR,EDVR,0);
+  InterlockedIncrement(&simReads);
+  simDelay();
+  size_t avail = dev->outLen - dev->outPos;
+  size_t n = (cnt < avail) ? cnt : avail;
+  memcpy(buf,dev->out + dev->outPos,n);
+  dev->outPos += n;
+  if (dev->outPos == dev->outLen) {
+    dev->outPos = 0;
+    dev->outLen = 0;
+  }
+  if (dev->failErr >= 0) {
+    // Injected failure, data read so far is still delivered
+    unsigned long err = (unsigned long)dev->failErr;
+    dev->failErr = -1;
+    return simStatus(ERR | CMPL,err,(unsigned long)n);
+  }
+  if (n == 0 && !dev->outEnd) {
+    // Nothing to talk about, device does not respond
+    return simStatus(ERR | TIMO,EABO,0);
+  }
+  if (dev->outLen == 0 && dev->outEnd) {
+    dev->outEnd = FALSE;
+    return simStatus(CMPL | END,0,(unsigned long)n);
+  }
+  return simStatus(CMPL,0,(unsigned long)n);
+}
+
+//------------------------------------------------------------------------------
+unsigned long NI488CC ibrsp(int ud, char *spr){
+  sim4882_device *dev = simLookup(ud);
+  if (dev == NULL) return simStatus(ERR,EDVR,0);
+  simDelay();
+  // MAV (bit 4) and RQS (bit 6) while a response is pending
+  *spr = (dev->outLen > 0) ? 0x50 : 0x00;
+  return simStatus(CMPL,0,0);
+}
+
+//------------------------------------------------------------------------------
+unsigned long NI488CC ibtrg(int ud){
+  sim4882_device *dev = simLookup(ud);
+  if (dev == NULL) return simStatus(ERR,EDVR,0);
+  simDelay();
+  return simStatus(CMPL,0,0);
+}
+
+//------------------------------------------------------------------------------
+unsigned long NI488CC ibwait(int ud, int mask){
+  sim4882_device *dev = simLookup(ud);
+  if (dev == NULL) return simStatus(ERR,EDVR,0);
+  unsigned long status = CMPL;
+  if (dev->outLen > 0) status |= RQS;
+  if (mask != 0 && (mask & status) == 0) {
+    // Waited event never happens on the simulated bus
+    simDelay();
+    status |= TIMO;
+  }
+  return simStatus(status,0,0);
+}
+
+//------------------------------------------------------------------------------
+unsigned long NI488CC ibwrt(int ud, const void *buf, size_t cnt){
+  sim4882_device *dev = simLookup(ud);
+  if (dev == NULL) return simStatus(ERR,EDVR,0);
+  simDelay();
+  if (memchr(buf,'?',cnt) != NULL) {
+    // Query, replaces any unread response
+    dev->outPos = 0;
+    dev->outLen = 0;
+    simQueue(dev,SIM_RESPONSE,strlen(SIM_RESPONSE),TRUE);
+  }
+  return simStatus(CMPL,0,(unsigned long)cnt);
+}
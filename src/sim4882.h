@@ -0,0 +1,52 @@
+/*
+--------------------------------------------------------------------------------
+MIT License
+
+lua4882 - Copyright (c) 2024-2025 Kritzel Kratzel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+--------------------------------------------------------------------------------
+*/
+
+// Simulated NI-488.2 bus for lua4882load and lua4882test. Implements the driver functions used
+// by lua4882.c with the prototypes from ni4882.h, so lua4882.c can be linked
+// against it instead of ni4882.obj.
+
+#ifndef SIM4882_H
+#define SIM4882_H
+
+#include <stddef.h>
+
+// Set simulated device latency in microseconds, applied to every bus access.
+void sim4882_setLatency(unsigned int latencyUs);
+
+// Append len bytes of data to the pending output of device ud. If end is
+// nonzero, END is asserted with the last byte, or with an empty read if no
+// data is pending.
+void sim4882_queue(int ud, const char *data, size_t len, int end);
+
+// Make the next read of device ud fail with ERR and iberr err after
+// delivering the pending output it would have returned otherwise.
+void sim4882_failNextRead(int ud, int err);
+
+// Total number of ibrd() calls on all devices.
+unsigned long sim4882_readCount(void);
+
+#endif